@@ -0,0 +1,172 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "chess_data.h"
+
+#define CHECK_PATH              "check_positions.bin"
+#define CHECK_THREADS           4
+#define CHECK_RECORDS_PER_THREAD 100000
+
+static Position positions[5];
+static size_t position_count = 0;
+static atomic_int failures = 0;
+
+#define CHECK(cond) do { \
+        if(!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures += 1; \
+        } \
+    } while(0)
+
+static void add_position(const char *fen)
+{
+    Position *position = &positions[position_count++];
+    position_init(position);
+    CHECK(position_load_fen(position, fen) == ERROR_NONE);
+}
+
+static void *writer_main(void *arg)
+{
+    PackedFile *file = arg;
+    static _Thread_local PackedWriter writer;
+    packed_writer_init(&writer, file);
+    for(size_t i = 0; i < CHECK_RECORDS_PER_THREAD; ++i) {
+        size_t index = i % position_count;
+        PackedPos record;
+        CHECK(position_pack(&positions[index], (int16_t)index, &record) == ERROR_NONE);
+        CHECK(packed_writer_push(&writer, &record) == ERROR_NONE);
+    }
+    CHECK(packed_writer_flush(&writer) == ERROR_NONE);
+    return NULL;
+}
+
+static void check_round_trip(void)
+{
+    Position start;
+    position_init(&start);
+    position_set_basic_start_pos(&start);
+    positions[position_count++] = start;
+    add_position("rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 1");
+    add_position("r3k2r/8/8/8/8/8/8/R3K2R w Kq - 12 40");
+    add_position("8/8/8/3k4/8/3K4/8/8 b - - 65535 65535");
+    add_position("rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPP1PPP/RNBQKBNR w KQkq f6 0 3");
+
+    PackedFile file;
+    CHECK(packed_file_open(&file, CHECK_PATH, false) == ERROR_NONE);
+    pthread_t threads[CHECK_THREADS];
+    for(size_t i = 0; i < CHECK_THREADS; ++i) pthread_create(&threads[i], NULL, writer_main, &file);
+    for(size_t i = 0; i < CHECK_THREADS; ++i) pthread_join(threads[i], NULL);
+    CHECK(file.record_count == CHECK_THREADS * CHECK_RECORDS_PER_THREAD);
+    CHECK(packed_file_close(&file) == ERROR_NONE);
+
+    PackedReader reader;
+    CHECK(packed_reader_open(&reader, CHECK_PATH) == ERROR_NONE);
+    CHECK(reader.count == CHECK_THREADS * CHECK_RECORDS_PER_THREAD);
+    for(size_t i = 0; i < reader.count; ++i) {
+        const PackedPos *record = &reader.items[i];
+        Position position;
+        CHECK(record->score >= 0 && (size_t)record->score < position_count);
+        CHECK(position_unpack(&position, record) == ERROR_NONE);
+        CHECK(memcmp(&position, &positions[record->score], sizeof(position)) == 0);
+        if(failures) break;
+    }
+    packed_reader_close(&reader);
+
+    // A partial record left by an interrupted flush does not hide the others
+    FILE *tail = fopen(CHECK_PATH, "ab");
+    CHECK(tail != NULL);
+    if(tail) {
+        fwrite("torn", 1, 4, tail);
+        fclose(tail);
+    }
+    CHECK(packed_reader_open(&reader, CHECK_PATH) == ERROR_NONE);
+    CHECK(reader.count == CHECK_THREADS * CHECK_RECORDS_PER_THREAD);
+    packed_reader_close(&reader);
+    remove(CHECK_PATH);
+}
+
+static void check_castling_updates(void)
+{
+    Position position;
+    position_init(&position);
+    CHECK(position_load_fen(&position, "r3k2r/8/8/8/8/8/8/R3K2R w KQkq - 0 1") == ERROR_NONE);
+    CHECK(position.castling == 0);
+
+    position_do_move(&position, (Move){ .from = pos_from("e1"), .to = pos_from("f1") });
+    position_do_move(&position, (Move){ .from = pos_from("a8"), .to = pos_from("a7") });
+    CHECK(position.castling == (CASTLING_WHITE_KING_MOVED | CASTLING_BLACK_QUEENSIDE_ROOK_MOVED));
+
+    // Capturing the rook on h8 ends black's kingside right as well
+    position_do_move(&position, (Move){ .from = pos_from("h1"), .to = pos_from("h8") });
+    CHECK(position.castling == (CASTLING_WHITE_KING_MOVED | CASTLING_WHITE_KINGSIDE_ROOK_MOVED |
+                                CASTLING_BLACK_QUEENSIDE_ROOK_MOVED | CASTLING_BLACK_KINGSIDE_ROOK_MOVED));
+
+    PackedPos record;
+    CHECK(position_pack(&position, 0, &record) == ERROR_NONE);
+    CHECK(record.flags >> PACKED_FLAG_CASTLING_SHIFT == position.castling);
+}
+
+static void check_game_round_trip(void)
+{
+    Game game = {0};
+    game_init(&game);
+    game_set_board_with_basic_start_pos(&game);
+    static const char *moves[][2] = {
+        { "e2", "e4" }, { "d7", "d5" }, { "e4", "d5" }, { "g8", "f6" },
+        { "e1", "e2" }, { "h8", "g8" }, { "g1", "f3" }, { "c7", "c5" },
+    };
+    for(size_t i = 0; i < sizeof(moves)/sizeof(*moves); ++i) {
+        game_do_move(&game, (Move){ .from = pos_from(moves[i][0]), .to = pos_from(moves[i][1]) });
+
+        PackedPos record;
+        Position position;
+        CHECK(position_pack(&game.position, (int16_t)i, &record) == ERROR_NONE);
+        CHECK(position_unpack(&position, &record) == ERROR_NONE);
+        CHECK(memcmp(&position, &game.position, sizeof(position)) == 0);
+    }
+    CHECK(game.position.turn == PIECE_WHITE);
+    CHECK(game.position.en_passant.row == 5 && game.position.en_passant.col == 2);
+    CHECK(game.position.halfmove_clock == 0);
+    CHECK(game.position.fullmove_number == 5);
+    CHECK(game.position.castling == (CASTLING_WHITE_KING_MOVED | CASTLING_BLACK_KINGSIDE_ROOK_MOVED));
+    game_free(&game);
+}
+
+static void check_invalid_records(void)
+{
+    Position position;
+    PackedPos valid, record;
+    CHECK(position_pack(&positions[0], 0, &valid) == ERROR_NONE);
+
+    record = valid;
+    record.occupancy |= (uint64_t)1 << 32;
+    CHECK(position_unpack(&position, &record) == ERROR_INVALID_RECORD);
+
+    record = valid;
+    record.pieces[0] = 0xD0 | (record.pieces[0] & 0x0F);
+    CHECK(position_unpack(&position, &record) == ERROR_INVALID_RECORD);
+
+    record = valid;
+    record.en_passant = 64;
+    CHECK(position_unpack(&position, &record) == ERROR_INVALID_RECORD);
+
+    record = valid;
+    record.flags |= 1 << 7;
+    CHECK(position_unpack(&position, &record) == ERROR_INVALID_RECORD);
+}
+
+int main(void)
+{
+    check_round_trip();
+    check_castling_updates();
+    check_game_round_trip();
+    check_invalid_records();
+    if(failures) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
@@ -4,6 +4,7 @@
 #include "chess.h"
 
 #ifndef CHESS_WASM
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h> // malloc, free
 void platform_putchar(int codepoint)
@@ -18,7 +19,7 @@ void platform_print_text(const char *text)
 
 void platform_print_int(int64_t value)
 {
-    printf("%lld", value);
+    printf("%" PRId64, value);
 }
 
 void *platform_heap_alloc(size_t size)
@@ -116,8 +117,8 @@ void move_dump(Move move)
     if(move.take != CELL_EMPTY) platform_putchar('x');
     pos_dump(move.to);
     if(move.promote != CELL_EMPTY) platform_putchar(cell_repr(move.promote));
-    if(move.check) platform_putchar(cell_repr('+'));
-    if(move.check && move.mate) platform_putchar(cell_repr('#'));
+    if(move.check) platform_putchar('+');
+    if(move.check && move.mate) platform_putchar('#');
 }
 
 void move_list_push(MoveList *list, Move move)
@@ -136,68 +137,144 @@ void move_list_push(MoveList *list, Move move)
     list->items[list->count++] = move; 
 }
 
+void position_init(Position *position)
+{
+    PLATFORM_ASSERT(position && "position_init: Invalid position instance");
+    internal_memset(position->board, 0, sizeof(position->board));
+    position->castling = 0;
+    position->turn = PIECE_WHITE;
+    position->en_passant = POS(-1, -1);
+    position->halfmove_clock = 0;
+    position->fullmove_number = 1;
+}
+
+Cell position_get(const Position *position, Pos pos)
+{
+    PLATFORM_ASSERT(position && "position_get: Invalid position instance");
+    PLATFORM_ASSERT(0 <= pos.row && pos.row < 8);
+    PLATFORM_ASSERT(0 <= pos.col && pos.col < 8);
+    return (Cell)position->board[pos.row * 8 + pos.col];
+}
+
+void position_set(Position *position, Pos pos, Cell cell)
+{
+    PLATFORM_ASSERT(position && "position_set: Invalid position instance");
+    PLATFORM_ASSERT(0 <= pos.row && pos.row < 8);
+    PLATFORM_ASSERT(0 <= pos.col && pos.col < 8);
+    position->board[pos.row * 8 + pos.col] = (uint8_t)cell;
+}
+
+void position_set_basic_start_pos(Position *position)
+{
+    PLATFORM_ASSERT(position && "position_set_basic_start_pos: Invalid position instance");
+    internal_memset(position->board, 0, sizeof(position->board));
+    position_set(position, POS(0, 0), CELL_W_ROOK);
+    position_set(position, POS(0, 1), CELL_W_KNIGHT);
+    position_set(position, POS(0, 2), CELL_W_BISHOP);
+    position_set(position, POS(0, 3), CELL_W_QUEEN);
+    position_set(position, POS(0, 4), CELL_W_KING);
+    position_set(position, POS(0, 5), CELL_W_BISHOP);
+    position_set(position, POS(0, 6), CELL_W_KNIGHT);
+    position_set(position, POS(0, 7), CELL_W_ROOK);
+    position_set(position, POS(1, 0), CELL_W_PAWN);
+    position_set(position, POS(1, 1), CELL_W_PAWN);
+    position_set(position, POS(1, 2), CELL_W_PAWN);
+    position_set(position, POS(1, 3), CELL_W_PAWN);
+    position_set(position, POS(1, 4), CELL_W_PAWN);
+    position_set(position, POS(1, 5), CELL_W_PAWN);
+    position_set(position, POS(1, 6), CELL_W_PAWN);
+    position_set(position, POS(1, 7), CELL_W_PAWN);
+    position_set(position, POS(6, 0), CELL_B_PAWN);
+    position_set(position, POS(6, 1), CELL_B_PAWN);
+    position_set(position, POS(6, 2), CELL_B_PAWN);
+    position_set(position, POS(6, 3), CELL_B_PAWN);
+    position_set(position, POS(6, 4), CELL_B_PAWN);
+    position_set(position, POS(6, 5), CELL_B_PAWN);
+    position_set(position, POS(6, 6), CELL_B_PAWN);
+    position_set(position, POS(6, 7), CELL_B_PAWN);
+    position_set(position, POS(7, 0), CELL_B_ROOK);
+    position_set(position, POS(7, 1), CELL_B_KNIGHT);
+    position_set(position, POS(7, 2), CELL_B_BISHOP);
+    position_set(position, POS(7, 3), CELL_B_QUEEN);
+    position_set(position, POS(7, 4), CELL_B_KING);
+    position_set(position, POS(7, 5), CELL_B_BISHOP);
+    position_set(position, POS(7, 6), CELL_B_KNIGHT);
+    position_set(position, POS(7, 7), CELL_B_ROOK);
+}
+
+static uint8_t _castling_rook_flag(Pos pos)
+{
+    if(pos.row == 0 && pos.col == 0) return CASTLING_WHITE_QUEENSIDE_ROOK_MOVED;
+    if(pos.row == 0 && pos.col == 7) return CASTLING_WHITE_KINGSIDE_ROOK_MOVED;
+    if(pos.row == 7 && pos.col == 0) return CASTLING_BLACK_QUEENSIDE_ROOK_MOVED;
+    if(pos.row == 7 && pos.col == 7) return CASTLING_BLACK_KINGSIDE_ROOK_MOVED;
+    return 0;
+}
+
+void position_do_move(Position *position, Move move)
+{
+    PLATFORM_ASSERT(position && "position_do_move: Invalid position instance");
+    Cell from = position_get(position, move.from);
+    Cell to = position_get(position, move.to);
+    position_set(position, move.from, CELL_EMPTY);
+    position_set(position, move.to, move.promote != CELL_EMPTY ? move.promote : from);
+
+    // A rook corner loses its castling right once anything leaves or lands on it,
+    // landing there means the rook was captured
+    if(from == CELL_W_KING && move.from.row == 0 && move.from.col == 4) position->castling |= CASTLING_WHITE_KING_MOVED;
+    if(from == CELL_B_KING && move.from.row == 7 && move.from.col == 4) position->castling |= CASTLING_BLACK_KING_MOVED;
+    position->castling |= _castling_rook_flag(move.from) | _castling_rook_flag(move.to);
+
+    bool is_pawn = from == CELL_W_PAWN || from == CELL_B_PAWN;
+    position->en_passant = POS(-1, -1);
+    if(is_pawn && (move.to.row - move.from.row == 2 || move.from.row - move.to.row == 2))
+        position->en_passant = POS((move.from.row + move.to.row) / 2, move.from.col);
+
+    if(is_pawn || to != CELL_EMPTY) position->halfmove_clock = 0;
+    else position->halfmove_clock += 1;
+    if(cell_piece_kind(from) == PIECE_BLACK) position->fullmove_number += 1;
+    position->turn = cell_piece_kind(from) == PIECE_BLACK ? PIECE_WHITE : PIECE_BLACK;
+}
+
+// Expects a zeroed or freed game, the move lists are not released here
 void game_init(Game *game)
 {
     PLATFORM_ASSERT(game && "game_init: Invalid game instance");
     game->history.count = 0;
+    game->history.capacity = 0;
     game->history.items = 0;
     game->valid_move_list.count = 0;
+    game->valid_move_list.capacity = 0;
     game->valid_move_list.items = 0;
-    internal_memset(game->board, 0, sizeof(game->board));
+    game->white_king_check = false;
+    game->black_king_check = false;
+    position_init(&game->position);
+}
+
+void game_free(Game *game)
+{
+    PLATFORM_ASSERT(game && "game_free: Invalid game instance");
+    platform_heap_free(game->history.items);
+    platform_heap_free(game->valid_move_list.items);
+    game_init(game);
 }
 
 Cell game_board_get(Game *game, Pos pos)
 {
     PLATFORM_ASSERT(game && "game_board_get: Invalid game instance");
-    PLATFORM_ASSERT(0 <= pos.row && pos.row < 8);
-    PLATFORM_ASSERT(0 <= pos.col && pos.col < 8);
-    return game->board[pos.row * 8 + pos.col];
+    return position_get(&game->position, pos);
 }
 
 void game_board_set(Game *game, Pos pos, Cell cell)
 {
     PLATFORM_ASSERT(game && "game_board_set: Invalid game instance");
-    PLATFORM_ASSERT(0 <= pos.row && pos.row < 8);
-    PLATFORM_ASSERT(0 <= pos.col && pos.col < 8);
-    game->board[pos.row * 8 + pos.col] = cell;
+    position_set(&game->position, pos, cell);
 }
 
 void game_set_board_with_basic_start_pos(Game *game)
 {
     PLATFORM_ASSERT(game && "game_set_board_with_basic_start_pos: Invalid game instance");
-    internal_memset(game->board, 0, sizeof(game->board));
-    game_board_set(game, POS(0, 0), CELL_W_ROOK);
-    game_board_set(game, POS(0, 1), CELL_W_KNIGHT);
-    game_board_set(game, POS(0, 2), CELL_W_BISHOP);
-    game_board_set(game, POS(0, 3), CELL_W_QUEEN);
-    game_board_set(game, POS(0, 4), CELL_W_KING);
-    game_board_set(game, POS(0, 5), CELL_W_BISHOP);
-    game_board_set(game, POS(0, 6), CELL_W_KNIGHT);
-    game_board_set(game, POS(0, 7), CELL_W_ROOK);
-    game_board_set(game, POS(1, 0), CELL_W_PAWN);
-    game_board_set(game, POS(1, 1), CELL_W_PAWN);
-    game_board_set(game, POS(1, 2), CELL_W_PAWN);
-    game_board_set(game, POS(1, 3), CELL_W_PAWN);
-    game_board_set(game, POS(1, 4), CELL_W_PAWN);
-    game_board_set(game, POS(1, 5), CELL_W_PAWN);
-    game_board_set(game, POS(1, 6), CELL_W_PAWN);
-    game_board_set(game, POS(1, 7), CELL_W_PAWN);
-    game_board_set(game, POS(6, 0), CELL_B_PAWN);
-    game_board_set(game, POS(6, 1), CELL_B_PAWN);
-    game_board_set(game, POS(6, 2), CELL_B_PAWN);
-    game_board_set(game, POS(6, 3), CELL_B_PAWN);
-    game_board_set(game, POS(6, 4), CELL_B_PAWN);
-    game_board_set(game, POS(6, 5), CELL_B_PAWN);
-    game_board_set(game, POS(6, 6), CELL_B_PAWN);
-    game_board_set(game, POS(6, 7), CELL_B_PAWN);
-    game_board_set(game, POS(7, 0), CELL_B_ROOK);
-    game_board_set(game, POS(7, 1), CELL_B_KNIGHT);
-    game_board_set(game, POS(7, 2), CELL_B_BISHOP);
-    game_board_set(game, POS(7, 3), CELL_B_QUEEN);
-    game_board_set(game, POS(7, 4), CELL_B_KING);
-    game_board_set(game, POS(7, 5), CELL_B_BISHOP);
-    game_board_set(game, POS(7, 6), CELL_B_KNIGHT);
-    game_board_set(game, POS(7, 7), CELL_B_ROOK);
+    position_set_basic_start_pos(&game->position);
 }
 
 void game_dump(Game *game)
@@ -219,10 +296,7 @@ void game_dump(Game *game)
 void game_do_move(Game *game, Move move)
 {
     PLATFORM_ASSERT(game  && "game_dump: Invalid game instance");
-    Cell from = game_board_get(game, move.from);
-    Cell to = game_board_get(game, move.to);
-    game_board_set(game, move.from, CELL_EMPTY);
-    game_board_set(game, move.to, from);
+    position_do_move(&game->position, move);
 }
 
 static Error _game_find_valid_moves_for_king(Game *game, Cell cell, Pos pos)
@@ -368,6 +442,7 @@ static Error _game_find_valid_moves_for_pawn(Game *game, Cell cell, Pos pos)
     // Forward
     {
         Pos  dst_pos  = POS(pos.row + y_dir, pos.col);
+        if(!IS_VALID_POS(dst_pos)) return ERROR_NONE;
         Cell dst_cell = game_board_get(game, dst_pos);
         if(dst_cell == CELL_EMPTY) {
             Move move = {0};
@@ -379,8 +454,7 @@ static Error _game_find_valid_moves_for_pawn(Game *game, Cell cell, Pos pos)
 
             if(pos.row == y_start) {
                 Pos  dst_pos  = POS(pos.row + 2 * y_dir, pos.col);
-                Cell dst_cell = game_board_get(game, dst_pos);
-                if(IS_VALID_POS(dst_pos) && dst_cell == CELL_EMPTY) {
+                if(IS_VALID_POS(dst_pos) && game_board_get(game, dst_pos) == CELL_EMPTY) {
                     Move move = {0};
                     move.piece = cell;
                     move.from = pos;
@@ -393,7 +467,7 @@ static Error _game_find_valid_moves_for_pawn(Game *game, Cell cell, Pos pos)
     }
     {
         Pos dst_pos = POS(pos.row + y_dir, pos.col - 1);
-        Cell dst_cell = game_board_get(game, dst_pos);
+        Cell dst_cell = IS_VALID_POS(dst_pos) ? game_board_get(game, dst_pos) : CELL_EMPTY;
         if(dst_cell != CELL_EMPTY && cell_piece_kind(dst_cell) != cell_piece_kind(cell)) {
             Move move = {0};
             move.piece = cell;
@@ -406,7 +480,7 @@ static Error _game_find_valid_moves_for_pawn(Game *game, Cell cell, Pos pos)
     }
     {
         Pos dst_pos = POS(pos.row + y_dir, pos.col + 1);
-        Cell dst_cell = game_board_get(game, dst_pos);
+        Cell dst_cell = IS_VALID_POS(dst_pos) ? game_board_get(game, dst_pos) : CELL_EMPTY;
         if(dst_cell != CELL_EMPTY && cell_piece_kind(dst_cell) != cell_piece_kind(cell)) {
             Move move = {0};
             move.piece = cell;
@@ -478,3 +552,175 @@ Error game_find_valid_moves(Game *game, Pos pos)
 
     return ERROR_NONE;
 }
+
+static const char *_fen_skip_spaces(const char *cursor)
+{
+    while(*cursor == ' ') ++cursor;
+    return cursor;
+}
+
+static const char *_fen_parse_uint(const char *cursor, uint16_t *value)
+{
+    if(*cursor < '0' || *cursor > '9') return NULL;
+    uint32_t result = 0;
+    while('0' <= *cursor && *cursor <= '9') {
+        result = result * 10 + (uint32_t)(*cursor++ - '0');
+        if(result > UINT16_MAX) return NULL;
+    }
+    *value = (uint16_t)result;
+    return cursor;
+}
+
+// The clock fields are optional. On error the position is left unspecified.
+Error position_load_fen(Position *position, const char *fen)
+{
+    PLATFORM_ASSERT(position && "position_load_fen: Invalid position instance");
+    PLATFORM_ASSERT(fen && "position_load_fen: Invalid fen string");
+    static const struct { char repr; Cell cell; } fen_cells[] = {
+        { 'P', CELL_W_PAWN }, { 'N', CELL_W_KNIGHT }, { 'B', CELL_W_BISHOP },
+        { 'R', CELL_W_ROOK }, { 'Q', CELL_W_QUEEN  }, { 'K', CELL_W_KING   },
+        { 'p', CELL_B_PAWN }, { 'n', CELL_B_KNIGHT }, { 'b', CELL_B_BISHOP },
+        { 'r', CELL_B_ROOK }, { 'q', CELL_B_QUEEN  }, { 'k', CELL_B_KING   },
+    };
+
+    const char *cursor = _fen_skip_spaces(fen);
+    internal_memset(position->board, 0, sizeof(position->board));
+    int8_t row = 7, col = 0;
+    for(; *cursor && *cursor != ' '; ++cursor) {
+        char c = *cursor;
+        if(c == '/') {
+            if(col != 8 || row == 0) return ERROR_INVALID_FEN;
+            row -= 1;
+            col = 0;
+        } else if('1' <= c && c <= '8') {
+            col += c - '0';
+            if(col > 8) return ERROR_INVALID_FEN;
+        } else {
+            Cell cell = CELL_EMPTY;
+            for(size_t i = 0; i < sizeof(fen_cells)/sizeof(*fen_cells); ++i) {
+                if(fen_cells[i].repr == c) cell = fen_cells[i].cell;
+            }
+            if(cell == CELL_EMPTY || col >= 8) return ERROR_INVALID_FEN;
+            position_set(position, POS(row, col), cell);
+            col += 1;
+        }
+    }
+    if(row != 0 || col != 8) return ERROR_INVALID_FEN;
+
+    cursor = _fen_skip_spaces(cursor);
+    if(*cursor == 'w') position->turn = PIECE_WHITE;
+    else if(*cursor == 'b') position->turn = PIECE_BLACK;
+    else return ERROR_INVALID_FEN;
+    cursor += 1;
+
+    // FEN only knows about castling rights, so a lost right is stored as the rook
+    // having moved and losing both rights as the king having moved.
+    cursor = _fen_skip_spaces(cursor);
+    bool rights[4] = {0}; // K, Q, k, q
+    if(*cursor == '-') {
+        cursor += 1;
+    } else {
+        for(; *cursor && *cursor != ' '; ++cursor) {
+            if(*cursor == 'K') rights[0] = true;
+            else if(*cursor == 'Q') rights[1] = true;
+            else if(*cursor == 'k') rights[2] = true;
+            else if(*cursor == 'q') rights[3] = true;
+            else return ERROR_INVALID_FEN;
+        }
+    }
+    position->castling = 0;
+    if(!rights[0])               position->castling |= CASTLING_WHITE_KINGSIDE_ROOK_MOVED;
+    if(!rights[1])               position->castling |= CASTLING_WHITE_QUEENSIDE_ROOK_MOVED;
+    if(!rights[0] && !rights[1]) position->castling |= CASTLING_WHITE_KING_MOVED;
+    if(!rights[2])               position->castling |= CASTLING_BLACK_KINGSIDE_ROOK_MOVED;
+    if(!rights[3])               position->castling |= CASTLING_BLACK_QUEENSIDE_ROOK_MOVED;
+    if(!rights[2] && !rights[3]) position->castling |= CASTLING_BLACK_KING_MOVED;
+
+    cursor = _fen_skip_spaces(cursor);
+    if(*cursor == '-') {
+        position->en_passant = POS(-1, -1);
+        cursor += 1;
+    } else {
+        if(cursor[0] < 'a' || cursor[0] > 'h' || cursor[1] < '1' || cursor[1] > '8') return ERROR_INVALID_FEN;
+        position->en_passant = pos_from(cursor);
+        cursor += 2;
+    }
+
+    position->halfmove_clock = 0;
+    position->fullmove_number = 1;
+    cursor = _fen_skip_spaces(cursor);
+    if(*cursor) {
+        cursor = _fen_parse_uint(cursor, &position->halfmove_clock);
+        if(!cursor) return ERROR_INVALID_FEN;
+        cursor = _fen_skip_spaces(cursor);
+    }
+    if(*cursor) {
+        cursor = _fen_parse_uint(cursor, &position->fullmove_number);
+        if(!cursor) return ERROR_INVALID_FEN;
+        cursor = _fen_skip_spaces(cursor);
+    }
+    if(*cursor) return ERROR_INVALID_FEN;
+    return ERROR_NONE;
+}
+
+Error position_pack(const Position *position, int16_t score, PackedPos *packed)
+{
+    PLATFORM_ASSERT(position && "position_pack: Invalid position instance");
+    PLATFORM_ASSERT(packed && "position_pack: Invalid packed position");
+    internal_memset(packed, 0, sizeof(*packed));
+
+    size_t piece_count = 0;
+    for(size_t square = 0; square < 8 * 8; ++square) {
+        uint8_t cell = position->board[square];
+        if(cell == CELL_EMPTY) continue;
+        if(piece_count >= 2 * sizeof(packed->pieces)) return ERROR_TOO_MANY_PIECES;
+        packed->occupancy |= (uint64_t)1 << square;
+        packed->pieces[piece_count / 2] |= (uint8_t)(cell << ((piece_count % 2) * 4));
+        piece_count += 1;
+    }
+
+    packed->score = score;
+    packed->flags = (uint8_t)(position->castling << PACKED_FLAG_CASTLING_SHIFT);
+    if(position->turn == PIECE_BLACK) packed->flags |= PACKED_FLAG_BLACK_TO_MOVE;
+    packed->en_passant = IS_VALID_POS(position->en_passant)
+        ? (uint8_t)(position->en_passant.row * 8 + position->en_passant.col)
+        : PACKED_NO_EN_PASSANT;
+    packed->halfmove_clock = position->halfmove_clock;
+    packed->fullmove_number = position->fullmove_number;
+    return ERROR_NONE;
+}
+
+// Records usually come straight from a file, so they are validated before the
+// position is touched. On error the position is left as it was.
+Error position_unpack(Position *position, const PackedPos *packed)
+{
+    PLATFORM_ASSERT(position && "position_unpack: Invalid position instance");
+    PLATFORM_ASSERT(packed && "position_unpack: Invalid packed position");
+    uint8_t known_flags = PACKED_FLAG_BLACK_TO_MOVE | (0x3F << PACKED_FLAG_CASTLING_SHIFT);
+    if(packed->flags & ~known_flags) return ERROR_INVALID_RECORD;
+    if(packed->en_passant >= 8 * 8 && packed->en_passant != PACKED_NO_EN_PASSANT) return ERROR_INVALID_RECORD;
+
+    Position result;
+    size_t piece_count = 0;
+    for(size_t square = 0; square < 8 * 8; ++square) {
+        if(!(packed->occupancy & ((uint64_t)1 << square))) {
+            result.board[square] = CELL_EMPTY;
+            continue;
+        }
+        if(piece_count >= 2 * sizeof(packed->pieces)) return ERROR_INVALID_RECORD;
+        uint8_t code = (packed->pieces[piece_count / 2] >> ((piece_count % 2) * 4)) & 0xF;
+        if(code == CELL_EMPTY || code > CELL_B_KING) return ERROR_INVALID_RECORD;
+        result.board[square] = code;
+        piece_count += 1;
+    }
+
+    result.turn = (packed->flags & PACKED_FLAG_BLACK_TO_MOVE) ? PIECE_BLACK : PIECE_WHITE;
+    result.castling = packed->flags >> PACKED_FLAG_CASTLING_SHIFT;
+    result.en_passant = packed->en_passant == PACKED_NO_EN_PASSANT
+        ? POS(-1, -1)
+        : POS(packed->en_passant / 8, packed->en_passant % 8);
+    result.halfmove_clock = packed->halfmove_clock;
+    result.fullmove_number = packed->fullmove_number;
+    *position = result;
+    return ERROR_NONE;
+}
@@ -23,6 +23,10 @@ typedef enum {
     ERROR_NONE = 0,
     ERROR_EMPTY_CELL,
     ERROR_INVALID_MOVE,
+    ERROR_TOO_MANY_PIECES,
+    ERROR_IO,
+    ERROR_INVALID_FEN,
+    ERROR_INVALID_RECORD,
 } Error;
 
 typedef enum {
@@ -82,16 +86,58 @@ typedef struct {
 } MoveList;
 void move_list_push(MoveList *list, Move move);
 
+// Set once the piece has left its starting cell, for castling
+#define CASTLING_WHITE_KING_MOVED           (1 << 0)
+#define CASTLING_WHITE_KINGSIDE_ROOK_MOVED  (1 << 1)
+#define CASTLING_WHITE_QUEENSIDE_ROOK_MOVED (1 << 2)
+#define CASTLING_BLACK_KING_MOVED           (1 << 3)
+#define CASTLING_BLACK_KINGSIDE_ROOK_MOVED  (1 << 4)
+#define CASTLING_BLACK_QUEENSIDE_ROOK_MOVED (1 << 5)
+
+// Plain board state without any heap-backed members, so it can be copied,
+// stored and handed between threads by value.
+typedef struct {
+    uint8_t board[8 * 8]; // Cell values, one byte each to keep the struct small
+    uint8_t castling;
+    uint8_t turn; // PieceKind
+    Pos en_passant; // Square skipped by the last double pawn push, POS(-1, -1) if none
+    uint16_t halfmove_clock;
+    uint16_t fullmove_number;
+} Position;
+_Static_assert(sizeof(Position) <= 128, "Position must fit in two cache lines");
+
+void position_init(Position *position);
+Cell position_get(const Position *position, Pos pos);
+void position_set(Position *position, Pos pos, Cell cell);
+void position_set_basic_start_pos(Position *position);
+void position_do_move(Position *position, Move move);
+Error position_load_fen(Position *position, const char *fen);
+
+// Fixed-size position record for bulk dumps (e.g. evaluation tuning data).
+// Occupied cells are stored as 4-bit Cell codes in ascending square order
+// (row * 8 + col), low nibble first. Multi-byte fields are in host byte order.
+// Bit 0 of flags is set when black is to move, bits 1 to 6 hold the CASTLING_* flags.
+#define PACKED_NO_EN_PASSANT 0xFF
+#define PACKED_FLAG_BLACK_TO_MOVE (1 << 0)
+#define PACKED_FLAG_CASTLING_SHIFT 1
+
+typedef struct {
+    uint64_t occupancy;
+    uint8_t  pieces[16];
+    int16_t  score;
+    uint8_t  flags;
+    uint8_t  en_passant;
+    uint16_t halfmove_clock;
+    uint16_t fullmove_number;
+} PackedPos;
+_Static_assert(sizeof(PackedPos) == 32, "PackedPos must stay 32 bytes");
+
+Error position_pack(const Position *position, int16_t score, PackedPos *packed);
+Error position_unpack(Position *position, const PackedPos *packed);
+
 typedef struct {
-    Cell board[8 * 8];
+    Position position;
     MoveList history;
-    // For castling
-    bool white_king_moved;
-    bool white_kingside_rook_moved;
-    bool white_queenside_rook_moved;
-    bool black_king_moved;
-    bool black_kingside_rook_moved;
-    bool black_queenside_rook_moved;
 
     // Non-serialized state
     bool white_king_check;
@@ -100,6 +146,7 @@ typedef struct {
 } Game;
 
 void game_init(Game *game);
+void game_free(Game *game);
 Cell game_board_get(Game *game, Pos pos);
 void game_board_set(Game *game, Pos pos, Cell cell);
 void game_set_board_with_basic_start_pos(Game *game);
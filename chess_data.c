@@ -0,0 +1,126 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "chess_data.h"
+
+Error packed_file_open(PackedFile *file, const char *path, bool append)
+{
+    PLATFORM_ASSERT(file && "packed_file_open: Invalid file instance");
+    int flags = O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC);
+    file->fd = open(path, flags, 0644);
+    if(file->fd < 0) return ERROR_IO;
+    pthread_mutex_init(&file->lock, NULL);
+    file->record_count = 0;
+    return ERROR_NONE;
+}
+
+Error packed_file_close(PackedFile *file)
+{
+    PLATFORM_ASSERT(file && "packed_file_close: Invalid file instance");
+    int result = close(file->fd);
+    pthread_mutex_destroy(&file->lock);
+    file->fd = -1;
+    return result == 0 ? ERROR_NONE : ERROR_IO;
+}
+
+static Error _packed_file_write_all(PackedFile *file, const void *data, size_t size)
+{
+    const uint8_t *cursor = data;
+    while(size > 0) {
+        ssize_t written = write(file->fd, cursor, size);
+        if(written < 0) {
+            if(errno == EINTR) continue;
+            return ERROR_IO;
+        }
+        cursor += written;
+        size -= (size_t)written;
+    }
+    return ERROR_NONE;
+}
+
+void packed_writer_init(PackedWriter *writer, PackedFile *file)
+{
+    PLATFORM_ASSERT(writer && "packed_writer_init: Invalid writer instance");
+    PLATFORM_ASSERT(file && "packed_writer_init: Invalid file instance");
+    writer->file = file;
+    writer->count = 0;
+}
+
+Error packed_writer_push(PackedWriter *writer, const PackedPos *record)
+{
+    PLATFORM_ASSERT(writer && "packed_writer_push: Invalid writer instance");
+    if(writer->count == PACKED_WRITER_CAPACITY) {
+        Error err = packed_writer_flush(writer);
+        if(err != ERROR_NONE) return err;
+    }
+    writer->buffer[writer->count++] = *record;
+    return ERROR_NONE;
+}
+
+Error packed_writer_flush(PackedWriter *writer)
+{
+    PLATFORM_ASSERT(writer && "packed_writer_flush: Invalid writer instance");
+    if(writer->count == 0) return ERROR_NONE;
+
+    PackedFile *file = writer->file;
+    pthread_mutex_lock(&file->lock);
+    off_t end = lseek(file->fd, 0, SEEK_END);
+    Error err = end < 0 ? ERROR_IO : _packed_file_write_all(file, writer->buffer, writer->count * sizeof(PackedPos));
+    if(err == ERROR_NONE) {
+        file->record_count += writer->count;
+    } else if(end >= 0) {
+        // Drop whatever part of the chunk made it, the file stays a whole number of
+        // records. If even that fails the reader still skips the partial tail.
+        if(ftruncate(file->fd, end) != 0) err = ERROR_IO;
+    }
+    pthread_mutex_unlock(&file->lock);
+
+    if(err == ERROR_NONE) writer->count = 0;
+    return err;
+}
+
+Error packed_reader_open(PackedReader *reader, const char *path)
+{
+    PLATFORM_ASSERT(reader && "packed_reader_open: Invalid reader instance");
+    reader->items = NULL;
+    reader->count = 0;
+    reader->map_size = 0;
+
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return ERROR_IO;
+
+    struct stat st;
+    if(fstat(fd, &st) < 0) {
+        close(fd);
+        return ERROR_IO;
+    }
+    // A crash in the middle of a flush can leave a partial record at the end, it is ignored
+    size_t count = (size_t)st.st_size / sizeof(PackedPos);
+    if(count == 0) {
+        close(fd);
+        return ERROR_NONE;
+    }
+
+    size_t map_size = count * sizeof(PackedPos);
+    void *map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) return ERROR_IO;
+    madvise(map, map_size, MADV_SEQUENTIAL);
+
+    reader->items = map;
+    reader->count = count;
+    reader->map_size = map_size;
+    return ERROR_NONE;
+}
+
+void packed_reader_close(PackedReader *reader)
+{
+    PLATFORM_ASSERT(reader && "packed_reader_close: Invalid reader instance");
+    if(reader->map_size > 0) munmap((void *)reader->items, reader->map_size);
+    reader->items = NULL;
+    reader->count = 0;
+    reader->map_size = 0;
+}
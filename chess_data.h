@@ -0,0 +1,48 @@
+#ifndef CHESS_DATA_H_
+#define CHESS_DATA_H_
+
+#include <pthread.h>
+
+#include "chess.h"
+
+// Streaming storage for PackedPos records. A data file is nothing but a flat
+// array of records, so shards can be concatenated with `cat`.
+// Native only, not available with CHESS_WASM.
+
+typedef struct {
+    int fd;
+    pthread_mutex_t lock;
+    uint64_t record_count;
+} PackedFile;
+
+Error packed_file_open(PackedFile *file, const char *path, bool append);
+Error packed_file_close(PackedFile *file);
+
+// Every thread owns one writer and any number of writers may share a PackedFile.
+// Records are buffered and land in the file in whole chunks, so records coming
+// from different writers never interleave byte-wise. When a flush fails the
+// file is cut back to its previous end and the records stay buffered, so the
+// flush can be retried.
+#define PACKED_WRITER_CAPACITY 4096
+typedef struct {
+    PackedFile *file;
+    size_t count;
+    PackedPos buffer[PACKED_WRITER_CAPACITY];
+} PackedWriter;
+
+void  packed_writer_init(PackedWriter *writer, PackedFile *file);
+Error packed_writer_push(PackedWriter *writer, const PackedPos *record);
+Error packed_writer_flush(PackedWriter *writer);
+
+// Memory-mapped read-only view, records are used straight from the mapping.
+// A partial record at the end of the file is ignored.
+typedef struct {
+    const PackedPos *items;
+    size_t count;
+    size_t map_size;
+} PackedReader;
+
+Error packed_reader_open(PackedReader *reader, const char *path);
+void  packed_reader_close(PackedReader *reader);
+
+#endif // CHESS_DATA_H_
@@ -0,0 +1,789 @@
+// chessd - long-running analysis daemon
+//
+// Serves perft style analysis (total and per root move node counts) over a
+// Unix domain socket. Requests are scheduled by priority on a fixed pool of
+// worker threads which all share one transposition table, so subtrees counted
+// for one request are reused by every later request.
+//
+// The counts come from the pseudo-legal move generator in chess.c: moves
+// leaving the own king in check are included, castling and en passant
+// captures are not generated. They do not match standard perft numbers
+// (depth 4 from the start position gives 197742, not 197281).
+//
+// Every message in both directions is a frame: a 4 byte big endian payload
+// length followed by an ASCII payload.
+//
+// Requests:
+//   analyze <id> <priority> <depth> <max_nodes> <movetime_ms> <fen>
+//   cancel <id>
+//   stats
+// Responses:
+//   result <id> <done|cancelled|nodes|time> nodes <n> visited <n> time_ms <t> moves [<uci>:<n> ...]
+//   cancel <id> <ok|unknown>
+//   stats queued <n> running <n> completed <n> p50_ms <t> p90_ms <t> p99_ms <t>
+//   error <id> <message>
+//
+// nodes is the perft total, visited the work actually done for it: leaves
+// generated plus subtrees taken from the shared table, which count as one.
+// max_nodes limits visited. A max_nodes or movetime_ms of 0 means no limit.
+// Ids are chosen by the client and are scoped to its connection. Higher
+// priorities are served first, equal priorities in arrival order.
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chess.h"
+
+#define CHESSD_DEFAULT_SOCKET  "/tmp/chessd.sock"
+#define CHESSD_DEFAULT_HASH_MB 64
+#define CHESSD_MAX_FRAME       (16 * 1024)
+#define CHESSD_MAX_DEPTH       32
+#define CHESSD_MAX_MOVES       256
+#define CHESSD_LATENCY_WINDOW  4096
+#define CHESSD_CHECK_INTERVAL  4096
+#define CHESSD_SEND_TIMEOUT_MS 2000
+
+typedef struct {
+    int fd;
+    pthread_mutex_t write_lock;
+    bool broken; // Guarded by write_lock
+    // Guarded by chessd.lock
+    int refcount;
+    bool closed;
+} Connection;
+
+typedef struct Job {
+    struct Job *prev;
+    struct Job *next;
+    Connection *conn;
+    uint32_t id;
+    int32_t priority;
+    uint64_t seq;
+    uint8_t depth;
+    uint64_t max_nodes;
+    uint64_t movetime_ms;
+    Position position;
+    double enqueued_at;
+    atomic_bool cancelled;
+} Job;
+
+typedef enum {
+    SEARCH_DONE = 0,
+    SEARCH_CANCELLED,
+    SEARCH_NODE_LIMIT,
+    SEARCH_TIME_LIMIT,
+    SEARCH_TOO_MANY_MOVES,
+} SearchStatus;
+
+typedef struct {
+    Game game;
+    Job *job;
+    uint64_t nodes;   // perft total, including subtrees taken from the table
+    uint64_t visited; // leaves generated and table hits, what max_nodes limits
+    uint64_t next_check;
+    double deadline;
+    SearchStatus status;
+} Search;
+
+// Lockless shared table: an entry is valid only if check ^ data gives back the
+// key, so torn writes from racing workers are detected and ignored.
+typedef struct {
+    _Atomic uint64_t check;
+    _Atomic uint64_t data; // nodes << 8 | depth
+} TTEntry;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t job_ready;
+    Job **queue; // binary max-heap on (priority, -seq)
+    size_t queue_count;
+    size_t queue_capacity;
+    Job *active; // queued and running jobs, for cancellation
+    uint64_t next_seq;
+    size_t running;
+    uint64_t completed;
+    bool stopping;
+    double latencies[CHESSD_LATENCY_WINDOW];
+    size_t latency_count;
+    size_t latency_next;
+
+    TTEntry *tt;
+    uint64_t tt_mask;
+    uint64_t zobrist_cells[8 * 8][CELL_B_KING + 1];
+    uint64_t zobrist_black_to_move;
+    uint64_t zobrist_flags[6];
+    uint64_t zobrist_en_passant[8 * 8];
+} chessd = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .job_ready = PTHREAD_COND_INITIALIZER,
+};
+
+static volatile sig_atomic_t chessd_stop = 0;
+
+static double _now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1000000.0;
+}
+
+static uint64_t _splitmix64(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static void _zobrist_init(void)
+{
+    uint64_t state = 0x43686573734421ull;
+    for(size_t square = 0; square < 8 * 8; ++square) {
+        for(size_t cell = 0; cell <= CELL_B_KING; ++cell) {
+            chessd.zobrist_cells[square][cell] = cell == CELL_EMPTY ? 0 : _splitmix64(&state);
+        }
+        chessd.zobrist_en_passant[square] = _splitmix64(&state);
+    }
+    for(size_t i = 0; i < 6; ++i) chessd.zobrist_flags[i] = _splitmix64(&state);
+    chessd.zobrist_black_to_move = _splitmix64(&state);
+}
+
+static uint64_t _zobrist_hash(const Position *position)
+{
+    uint64_t key = 0;
+    for(size_t square = 0; square < 8 * 8; ++square) {
+        key ^= chessd.zobrist_cells[square][position->board[square]];
+    }
+    if(position->turn == PIECE_BLACK) key ^= chessd.zobrist_black_to_move;
+    for(size_t i = 0; i < 6; ++i) {
+        if(position->castling & (1 << i)) key ^= chessd.zobrist_flags[i];
+    }
+    if(IS_VALID_POS(position->en_passant)) {
+        key ^= chessd.zobrist_en_passant[position->en_passant.row * 8 + position->en_passant.col];
+    }
+    return key;
+}
+
+static bool _tt_init(size_t size_mb)
+{
+    uint64_t count = 1;
+    while(count * 2 * sizeof(TTEntry) <= (uint64_t)size_mb * 1024 * 1024) count *= 2;
+    chessd.tt = calloc(count, sizeof(TTEntry));
+    if(!chessd.tt) return false;
+    chessd.tt_mask = count - 1;
+    return true;
+}
+
+static bool _tt_probe(uint64_t key, uint8_t depth, uint64_t *nodes)
+{
+    TTEntry *entry = &chessd.tt[key & chessd.tt_mask];
+    uint64_t check = atomic_load_explicit(&entry->check, memory_order_relaxed);
+    uint64_t data = atomic_load_explicit(&entry->data, memory_order_relaxed);
+    if((check ^ data) != key || (data & 0xFF) != depth) return false;
+    *nodes = data >> 8;
+    return true;
+}
+
+static void _tt_store(uint64_t key, uint8_t depth, uint64_t nodes)
+{
+    TTEntry *entry = &chessd.tt[key & chessd.tt_mask];
+    uint64_t data = nodes << 8 | depth;
+    atomic_store_explicit(&entry->check, key ^ data, memory_order_relaxed);
+    atomic_store_explicit(&entry->data, data, memory_order_relaxed);
+}
+
+// Fails if the position has more than CHESSD_MAX_MOVES pseudo-legal moves
+static bool _collect_moves(Game *game, Move *moves, size_t *count)
+{
+    *count = 0;
+    for(int8_t row = 0; row < 8; ++row) {
+        for(int8_t col = 0; col < 8; ++col) {
+            if(cell_piece_kind(game_board_get(game, POS(row, col))) != game->position.turn) continue;
+            if(game_find_valid_moves(game, POS(row, col)) != ERROR_NONE) continue;
+            for(size_t i = 0; i < game->valid_move_list.count; ++i) {
+                if(*count >= CHESSD_MAX_MOVES) return false;
+                moves[(*count)++] = game->valid_move_list.items[i];
+            }
+        }
+    }
+    return true;
+}
+
+static bool _search_should_stop(Search *search)
+{
+    if(search->status != SEARCH_DONE) return true;
+    if(search->job->max_nodes && search->visited >= search->job->max_nodes) {
+        search->status = SEARCH_NODE_LIMIT;
+    } else if(search->visited >= search->next_check) {
+        search->next_check = search->visited + CHESSD_CHECK_INTERVAL;
+        if(atomic_load(&search->job->cancelled)) search->status = SEARCH_CANCELLED;
+        else if(search->deadline > 0 && _now_ms() >= search->deadline) search->status = SEARCH_TIME_LIMIT;
+    }
+    return search->status != SEARCH_DONE;
+}
+
+static uint64_t _perft(Search *search, uint8_t depth)
+{
+    if(depth == 0) {
+        search->nodes += 1;
+        search->visited += 1;
+        _search_should_stop(search);
+        return 1;
+    }
+
+    uint64_t key = _zobrist_hash(&search->game.position);
+    uint64_t nodes = 0;
+    if(depth > 1 && _tt_probe(key, depth, &nodes)) {
+        search->nodes += nodes;
+        search->visited += 1;
+        _search_should_stop(search);
+        return nodes;
+    }
+
+    Move moves[CHESSD_MAX_MOVES];
+    size_t move_count = 0;
+    if(!_collect_moves(&search->game, moves, &move_count)) {
+        search->status = SEARCH_TOO_MANY_MOVES;
+        return nodes;
+    }
+    if(depth == 1) {
+        search->nodes += move_count;
+        search->visited += move_count;
+        _search_should_stop(search);
+        return move_count;
+    }
+
+    Position saved = search->game.position;
+    for(size_t i = 0; i < move_count; ++i) {
+        game_do_move(&search->game, moves[i]);
+        nodes += _perft(search, depth - 1);
+        search->game.position = saved;
+        if(search->status != SEARCH_DONE) return nodes;
+    }
+    _tt_store(key, depth, nodes);
+    return nodes;
+}
+
+static size_t _append(char *buffer, size_t size, size_t length, const char *fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+
+static size_t _append(char *buffer, size_t size, size_t length, const char *fmt, ...)
+{
+    if(length >= size) return length;
+    va_list args;
+    va_start(args, fmt);
+    int written = vsnprintf(buffer + length, size - length, fmt, args);
+    va_end(args);
+    return written < 0 ? length : length + (size_t)written;
+}
+
+static bool _write_all(int fd, const void *data, size_t size)
+{
+    const uint8_t *cursor = data;
+    while(size > 0) {
+        ssize_t written = send(fd, cursor, size, MSG_NOSIGNAL);
+        if(written < 0) {
+            if(errno == EINTR) continue;
+            return false;
+        }
+        cursor += written;
+        size -= (size_t)written;
+    }
+    return true;
+}
+
+static bool _read_all(int fd, void *data, size_t size)
+{
+    uint8_t *cursor = data;
+    while(size > 0) {
+        ssize_t count = recv(fd, cursor, size, 0);
+        if(count < 0 && errno == EINTR) continue;
+        if(count <= 0) return false;
+        cursor += count;
+        size -= (size_t)count;
+    }
+    return true;
+}
+
+static void _send_frame(Connection *conn, const char *payload, size_t length)
+{
+    if(length > CHESSD_MAX_FRAME) length = CHESSD_MAX_FRAME;
+    uint32_t header = htonl((uint32_t)length);
+    pthread_mutex_lock(&conn->write_lock);
+    // A client that stops reading must not hold workers hostage: once a send
+    // times out the connection is shut down, which also ends its reader thread
+    // and cancels its remaining jobs
+    if(!conn->broken) {
+        bool sent = _write_all(conn->fd, &header, sizeof(header)) && _write_all(conn->fd, payload, length);
+        if(!sent) {
+            conn->broken = true;
+            shutdown(conn->fd, SHUT_RDWR);
+        }
+    }
+    pthread_mutex_unlock(&conn->write_lock);
+}
+
+static void _send_error(Connection *conn, uint32_t id, const char *message)
+{
+    char payload[256];
+    int length = snprintf(payload, sizeof(payload), "error %" PRIu32 " %s", id, message);
+    _send_frame(conn, payload, (size_t)length);
+}
+
+// Must be called with chessd.lock held
+static void _connection_release(Connection *conn)
+{
+    conn->refcount -= 1;
+    if(conn->refcount > 0) return;
+    close(conn->fd);
+    pthread_mutex_destroy(&conn->write_lock);
+    free(conn);
+}
+
+static bool _job_before(const Job *a, const Job *b)
+{
+    if(a->priority != b->priority) return a->priority > b->priority;
+    return a->seq < b->seq;
+}
+
+// Must be called with chessd.lock held
+static bool _queue_push(Job *job)
+{
+    if(chessd.queue_count == chessd.queue_capacity) {
+        size_t new_capacity = chessd.queue_capacity ? chessd.queue_capacity * 2 : 64;
+        Job **new_queue = realloc(chessd.queue, new_capacity * sizeof(*new_queue));
+        if(!new_queue) return false;
+        chessd.queue = new_queue;
+        chessd.queue_capacity = new_capacity;
+    }
+    size_t i = chessd.queue_count++;
+    while(i > 0) {
+        size_t parent = (i - 1) / 2;
+        if(!_job_before(job, chessd.queue[parent])) break;
+        chessd.queue[i] = chessd.queue[parent];
+        i = parent;
+    }
+    chessd.queue[i] = job;
+    return true;
+}
+
+// Must be called with chessd.lock held and a non-empty queue
+static Job *_queue_pop(void)
+{
+    Job *top = chessd.queue[0];
+    Job *last = chessd.queue[--chessd.queue_count];
+    size_t i = 0;
+    for(;;) {
+        size_t child = 2 * i + 1;
+        if(child >= chessd.queue_count) break;
+        if(child + 1 < chessd.queue_count && _job_before(chessd.queue[child + 1], chessd.queue[child])) child += 1;
+        if(!_job_before(chessd.queue[child], last)) break;
+        chessd.queue[i] = chessd.queue[child];
+        i = child;
+    }
+    if(chessd.queue_count > 0) chessd.queue[i] = last;
+    return top;
+}
+
+static int _compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Runs the job and writes the response frame into payload, returning its length
+static size_t _run_job(Search *search, Job *job, char *payload, size_t size)
+{
+    static const char *status_names[] = {
+        [SEARCH_DONE]       = "done",
+        [SEARCH_CANCELLED]  = "cancelled",
+        [SEARCH_NODE_LIMIT] = "nodes",
+        [SEARCH_TIME_LIMIT] = "time",
+    };
+
+    double started_at = _now_ms();
+    search->game.position = job->position;
+    search->job = job;
+    search->nodes = 0;
+    search->visited = 0;
+    search->next_check = 0;
+    search->deadline = job->movetime_ms ? started_at + (double)job->movetime_ms : 0;
+    search->status = atomic_load(&job->cancelled) ? SEARCH_CANCELLED : SEARCH_DONE;
+
+    size_t length = 0;
+    char moves_text[CHESSD_MAX_FRAME];
+    size_t moves_length = 0;
+
+    if(search->status == SEARCH_DONE && job->depth == 0) {
+        search->nodes = 1;
+        search->visited = 1;
+    } else if(search->status == SEARCH_DONE) {
+        Move moves[CHESSD_MAX_MOVES];
+        size_t move_count = 0;
+        if(!_collect_moves(&search->game, moves, &move_count)) search->status = SEARCH_TOO_MANY_MOVES;
+        Position saved = search->game.position;
+        for(size_t i = 0; i < move_count && search->status == SEARCH_DONE; ++i) {
+            Move move = moves[i];
+            game_do_move(&search->game, move);
+            uint64_t nodes = _perft(search, job->depth - 1);
+            search->game.position = saved;
+            if(search->status != SEARCH_DONE) break;
+            moves_length = _append(moves_text, sizeof(moves_text), moves_length, " %c%c%c%c",
+                                   'a' + move.from.col, '1' + move.from.row, 'a' + move.to.col, '1' + move.to.row);
+            if(move.promote != CELL_EMPTY) {
+                moves_length = _append(moves_text, sizeof(moves_text), moves_length, "%c",
+                                       cell_repr(move.promote) | 0x20);
+            }
+            moves_length = _append(moves_text, sizeof(moves_text), moves_length, ":%" PRIu64, nodes);
+        }
+    }
+
+    if(search->status == SEARCH_TOO_MANY_MOVES) {
+        return _append(payload, size, length, "error %" PRIu32 " too many moves in position", job->id);
+    }
+
+    length = _append(payload, size, length,
+                     "result %" PRIu32 " %s nodes %" PRIu64 " visited %" PRIu64 " time_ms %.3f moves%s",
+                     job->id, status_names[search->status], search->nodes, search->visited,
+                     _now_ms() - started_at, moves_length ? moves_text : "");
+    return length < size ? length : size - 1;
+}
+
+static void *_worker_main(void *arg)
+{
+    (void)arg;
+    Search *search = calloc(1, sizeof(*search));
+    PLATFORM_ASSERT(search != NULL && "Buy More RAM LOL!");
+    game_init(&search->game);
+    char payload[CHESSD_MAX_FRAME];
+
+    for(;;) {
+        pthread_mutex_lock(&chessd.lock);
+        while(chessd.queue_count == 0 && !chessd.stopping) pthread_cond_wait(&chessd.job_ready, &chessd.lock);
+        if(chessd.queue_count == 0) {
+            pthread_mutex_unlock(&chessd.lock);
+            break;
+        }
+        Job *job = _queue_pop();
+        chessd.running += 1;
+        bool closed = job->conn->closed;
+        pthread_mutex_unlock(&chessd.lock);
+
+        size_t length = closed ? 0 : _run_job(search, job, payload, sizeof(payload));
+
+        // Book the job as finished before answering, so that a stats request
+        // sent right after the result already accounts for it. Jobs dropped
+        // because their client left never ran and stay out of the statistics.
+        pthread_mutex_lock(&chessd.lock);
+        chessd.running -= 1;
+        if(!closed) {
+            chessd.completed += 1;
+            chessd.latencies[chessd.latency_next] = _now_ms() - job->enqueued_at;
+            chessd.latency_next = (chessd.latency_next + 1) % CHESSD_LATENCY_WINDOW;
+            if(chessd.latency_count < CHESSD_LATENCY_WINDOW) chessd.latency_count += 1;
+        }
+        if(job->prev) job->prev->next = job->next;
+        else chessd.active = job->next;
+        if(job->next) job->next->prev = job->prev;
+        pthread_mutex_unlock(&chessd.lock);
+
+        if(!closed) _send_frame(job->conn, payload, length);
+
+        pthread_mutex_lock(&chessd.lock);
+        _connection_release(job->conn);
+        pthread_mutex_unlock(&chessd.lock);
+        free(job);
+    }
+
+    game_free(&search->game);
+    free(search);
+    return NULL;
+}
+
+// Returns why the position can not be analysed, or NULL if it can
+static const char *_position_rejection(const Position *position)
+{
+    size_t piece_count = 0, white_kings = 0, black_kings = 0;
+    for(size_t square = 0; square < 8 * 8; ++square) {
+        Cell cell = (Cell)position->board[square];
+        if(cell == CELL_EMPTY) continue;
+        piece_count += 1;
+        if(cell == CELL_W_KING) white_kings += 1;
+        if(cell == CELL_B_KING) black_kings += 1;
+        bool back_rank = square < 8 || square >= 7 * 8;
+        if(back_rank && (cell == CELL_W_PAWN || cell == CELL_B_PAWN)) return "pawn on first or last rank";
+    }
+    if(piece_count > 32) return "too many pieces";
+    if(white_kings != 1 || black_kings != 1) return "need exactly one king per side";
+    return NULL;
+}
+
+static void _handle_analyze(Connection *conn, const char *args)
+{
+    uint32_t id = 0;
+    int32_t priority = 0;
+    unsigned depth = 0;
+    uint64_t max_nodes = 0, movetime_ms = 0;
+    int fen_offset = 0;
+    if(sscanf(args, "%" SCNu32 " %" SCNd32 " %u %" SCNu64 " %" SCNu64 " %n",
+              &id, &priority, &depth, &max_nodes, &movetime_ms, &fen_offset) < 5 || fen_offset == 0) {
+        _send_error(conn, id, "usage: analyze <id> <priority> <depth> <max_nodes> <movetime_ms> <fen>");
+        return;
+    }
+    if(depth > CHESSD_MAX_DEPTH) {
+        _send_error(conn, id, "depth too large");
+        return;
+    }
+
+    Job *job = calloc(1, sizeof(*job));
+    if(!job) {
+        _send_error(conn, id, "out of memory");
+        return;
+    }
+    if(position_load_fen(&job->position, args + fen_offset) != ERROR_NONE) {
+        free(job);
+        _send_error(conn, id, "invalid fen");
+        return;
+    }
+    const char *rejection = _position_rejection(&job->position);
+    if(rejection) {
+        free(job);
+        _send_error(conn, id, rejection);
+        return;
+    }
+    job->conn = conn;
+    job->id = id;
+    job->priority = priority;
+    job->depth = (uint8_t)depth;
+    job->max_nodes = max_nodes;
+    job->movetime_ms = movetime_ms;
+    job->enqueued_at = _now_ms();
+    atomic_init(&job->cancelled, false);
+
+    pthread_mutex_lock(&chessd.lock);
+    job->seq = chessd.next_seq++;
+    if(!_queue_push(job)) {
+        pthread_mutex_unlock(&chessd.lock);
+        free(job);
+        _send_error(conn, id, "out of memory");
+        return;
+    }
+    conn->refcount += 1;
+    job->next = chessd.active;
+    if(chessd.active) chessd.active->prev = job;
+    chessd.active = job;
+    pthread_cond_signal(&chessd.job_ready);
+    pthread_mutex_unlock(&chessd.lock);
+}
+
+static void _handle_cancel(Connection *conn, const char *args)
+{
+    uint32_t id = 0;
+    if(sscanf(args, "%" SCNu32, &id) != 1) {
+        _send_error(conn, 0, "usage: cancel <id>");
+        return;
+    }
+
+    bool found = false;
+    pthread_mutex_lock(&chessd.lock);
+    for(Job *job = chessd.active; job; job = job->next) {
+        if(job->conn != conn || job->id != id) continue;
+        atomic_store(&job->cancelled, true);
+        found = true;
+    }
+    pthread_mutex_unlock(&chessd.lock);
+
+    char payload[64];
+    int length = snprintf(payload, sizeof(payload), "cancel %" PRIu32 " %s", id, found ? "ok" : "unknown");
+    _send_frame(conn, payload, (size_t)length);
+}
+
+static void _handle_stats(Connection *conn)
+{
+    static double sorted[CHESSD_LATENCY_WINDOW];
+    static pthread_mutex_t sorted_lock = PTHREAD_MUTEX_INITIALIZER;
+
+    pthread_mutex_lock(&sorted_lock);
+    pthread_mutex_lock(&chessd.lock);
+    size_t queued = chessd.queue_count;
+    size_t running = chessd.running;
+    uint64_t completed = chessd.completed;
+    size_t count = chessd.latency_count;
+    memcpy(sorted, chessd.latencies, count * sizeof(*sorted));
+    pthread_mutex_unlock(&chessd.lock);
+
+    qsort(sorted, count, sizeof(*sorted), _compare_double);
+    double p50 = count ? sorted[count * 50 / 100] : 0;
+    double p90 = count ? sorted[count * 90 / 100] : 0;
+    double p99 = count ? sorted[count * 99 / 100] : 0;
+    pthread_mutex_unlock(&sorted_lock);
+
+    char payload[256];
+    int length = snprintf(payload, sizeof(payload),
+                          "stats queued %zu running %zu completed %" PRIu64 " p50_ms %.3f p90_ms %.3f p99_ms %.3f",
+                          queued, running, completed, p50, p90, p99);
+    _send_frame(conn, payload, (size_t)length);
+}
+
+static void *_connection_main(void *arg)
+{
+    Connection *conn = arg;
+    char payload[CHESSD_MAX_FRAME + 1];
+
+    for(;;) {
+        uint32_t header = 0;
+        if(!_read_all(conn->fd, &header, sizeof(header))) break;
+        uint32_t length = ntohl(header);
+        if(length > CHESSD_MAX_FRAME) break;
+        if(!_read_all(conn->fd, payload, length)) break;
+        payload[length] = '\0';
+
+        if(strncmp(payload, "analyze ", 8) == 0) _handle_analyze(conn, payload + 8);
+        else if(strncmp(payload, "cancel ", 7) == 0) _handle_cancel(conn, payload + 7);
+        else if(strcmp(payload, "stats") == 0) _handle_stats(conn);
+        else _send_error(conn, 0, "unknown command");
+    }
+
+    // Whatever the client left behind is not worth computing anymore
+    pthread_mutex_lock(&chessd.lock);
+    conn->closed = true;
+    for(Job *job = chessd.active; job; job = job->next) {
+        if(job->conn == conn) atomic_store(&job->cancelled, true);
+    }
+    _connection_release(conn);
+    pthread_mutex_unlock(&chessd.lock);
+    return NULL;
+}
+
+static void _handle_stop_signal(int signal)
+{
+    (void)signal;
+    chessd_stop = 1;
+}
+
+static void _usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [-s socket_path] [-j workers] [-H hash_mb]\n", program);
+}
+
+int main(int argc, char **argv)
+{
+    const char *socket_path = CHESSD_DEFAULT_SOCKET;
+    long workers = sysconf(_SC_NPROCESSORS_ONLN);
+    long hash_mb = CHESSD_DEFAULT_HASH_MB;
+
+    int opt;
+    while((opt = getopt(argc, argv, "s:j:H:h")) != -1) {
+        switch(opt) {
+        case 's': socket_path = optarg; break;
+        case 'j': workers = strtol(optarg, NULL, 10); break;
+        case 'H': hash_mb = strtol(optarg, NULL, 10); break;
+        default: _usage(argv[0]); return 1;
+        }
+    }
+    if(workers < 1 || hash_mb < 1) {
+        _usage(argv[0]);
+        return 1;
+    }
+
+    _zobrist_init();
+    if(!_tt_init((size_t)hash_mb)) {
+        fprintf(stderr, "ERROR: could not allocate %ld MB of hash\n", hash_mb);
+        return 1;
+    }
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(server < 0) {
+        perror("socket");
+        return 1;
+    }
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if(strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "ERROR: socket path too long: %s\n", socket_path);
+        return 1;
+    }
+    strcpy(addr.sun_path, socket_path);
+    unlink(socket_path);
+    if(bind(server, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(server, 64) < 0) {
+        perror(socket_path);
+        return 1;
+    }
+
+    struct sigaction action = { .sa_handler = _handle_stop_signal };
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    pthread_t *worker_threads = calloc((size_t)workers, sizeof(*worker_threads));
+    if(!worker_threads) {
+        fprintf(stderr, "ERROR: could not allocate %ld workers\n", workers);
+        return 1;
+    }
+    for(long i = 0; i < workers; ++i) {
+        if(pthread_create(&worker_threads[i], NULL, _worker_main, NULL) != 0) {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+    printf("chessd: listening on %s with %ld workers and %ld MB hash\n", socket_path, workers, hash_mb);
+    fflush(stdout);
+
+    while(!chessd_stop) {
+        int fd = accept(server, NULL, NULL);
+        if(fd < 0) {
+            if(errno == EINTR) continue;
+            perror("accept");
+            break;
+        }
+
+        Connection *conn = calloc(1, sizeof(*conn));
+        if(!conn) {
+            close(fd);
+            continue;
+        }
+        struct timeval send_timeout = {
+            .tv_sec = CHESSD_SEND_TIMEOUT_MS / 1000,
+            .tv_usec = (CHESSD_SEND_TIMEOUT_MS % 1000) * 1000,
+        };
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+        conn->fd = fd;
+        conn->refcount = 1;
+        pthread_mutex_init(&conn->write_lock, NULL);
+
+        pthread_t thread;
+        if(pthread_create(&thread, NULL, _connection_main, conn) != 0) {
+            pthread_mutex_destroy(&conn->write_lock);
+            close(fd);
+            free(conn);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+
+    close(server);
+    unlink(socket_path);
+
+    // Pending jobs are cancelled, so workers drain the queue quickly and exit
+    pthread_mutex_lock(&chessd.lock);
+    chessd.stopping = true;
+    for(Job *job = chessd.active; job; job = job->next) atomic_store(&job->cancelled, true);
+    pthread_cond_broadcast(&chessd.job_ready);
+    pthread_mutex_unlock(&chessd.lock);
+    for(long i = 0; i < workers; ++i) pthread_join(worker_threads[i], NULL);
+    free(worker_threads);
+    free(chessd.tt);
+    return 0;
+}
@@ -33,4 +33,6 @@ int main(void)
     dump_with_movement_info(&game, "a3");
     dump_with_movement_info(&game, "c1");
     dump_with_movement_info(&game, "b7");
+
+    game_free(&game);
 }